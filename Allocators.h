@@ -0,0 +1,281 @@
+#ifndef FILTER_FINDER_ALLOCATORS_H
+#define FILTER_FINDER_ALLOCATORS_H
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <sys/mman.h>
+
+static constexpr size_t CACHE_LINE = 64;
+
+/*
+ * Rounds n up to the closest multiple of align
+ */
+static constexpr size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// -----------------------------------------------------------------------
+// ---------------------------- ALIGNED HEAP -----------------------------
+// -----------------------------------------------------------------------
+
+/*
+ * Allocates from the heap aligned to Align bytes. If Pad is set, CubeArray also pads every layer to a multiple
+ * of Align bytes, so that each layer starts on its own cache line
+ */
+template <typename T, size_t Align = CACHE_LINE, bool Pad = false>
+struct AlignedAllocator {
+    using value_type = T;
+    static constexpr size_t alignment = Align;
+    static constexpr bool pad_layers = Pad;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Align, Pad>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(AlignedAllocator<U, Align, Pad> const &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T *p, size_t) {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    bool operator==(AlignedAllocator const &) const { return true; }
+    bool operator!=(AlignedAllocator const &) const { return false; }
+};
+
+// -----------------------------------------------------------------------
+// -------------------------------- ARENA --------------------------------
+// -----------------------------------------------------------------------
+
+/*
+ * Bump allocator for temporaries. Allocating only moves an offset forward and freeing does nothing,
+ * instead everything is released at once by reset, or back to a mark by rewind.
+ * Once the arena has grown large enough for one batch, training allocates nothing from the heap
+ */
+class Arena {
+public:
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+
+    explicit Arena(size_t block_size_ = 1 << 20) : block_size(block_size_) {}
+    ~Arena() {
+        for (auto &block : blocks) {
+            ::operator delete(block.data, std::align_val_t(CACHE_LINE));
+        }
+    }
+    Arena(Arena const &) = delete;
+    Arena & operator=(Arena const &) = delete;
+
+    void *allocate(size_t bytes) {
+        bytes = round_up(bytes, CACHE_LINE);
+        while (current < blocks.size() && blocks[current].used + bytes > blocks[current].size) {
+            current++;
+        }
+        if (current == blocks.size()) {
+            size_t size = std::max(block_size, bytes);
+            blocks.push_back({static_cast<char *>(::operator new(size, std::align_val_t(CACHE_LINE))), size, 0});
+        }
+        void *p = blocks[current].data + blocks[current].used;
+        blocks[current].used += bytes;
+        return p;
+    }
+
+    /*
+     * Releases everything allocated so far. If the last round needed more than one block,
+     * they are merged so that the next round fits in a single one
+     */
+    void reset() {
+        if (blocks.size() > 1) {
+            size_t total = 0;
+            for (auto &block : blocks) {
+                total += block.size;
+                ::operator delete(block.data, std::align_val_t(CACHE_LINE));
+            }
+            blocks.clear();
+            block_size = std::max(block_size, total);
+        }
+        for (auto &block : blocks) {
+            block.used = 0;
+        }
+        current = 0;
+    }
+
+    Mark mark() const {
+        return {current, current < blocks.size() ? blocks[current].used : 0};
+    }
+
+    /*
+     * Releases everything allocated after mark was taken
+     */
+    void rewind(Mark const &mark) {
+        for (size_t i = mark.block + 1; i < blocks.size(); ++i) {
+            blocks[i].used = 0;
+        }
+        if (mark.block < blocks.size()) {
+            blocks[mark.block].used = mark.offset;
+        }
+        current = mark.block;
+    }
+
+    /*
+     * The arena ArenaAllocators constructed on this thread allocate from, nullptr if none
+     */
+    static Arena *& active() {
+        static thread_local Arena *arena = nullptr;
+        return arena;
+    }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+        size_t used;
+    };
+    std::vector<Block> blocks;
+    size_t block_size;
+    size_t current = 0;
+};
+
+/*
+ * Makes an arena the active one for as long as the scope lives
+ */
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena) : previous(Arena::active()) {
+        Arena::active() = &arena;
+    }
+    ~ArenaScope() {
+        Arena::active() = previous;
+    }
+    ArenaScope(ArenaScope const &) = delete;
+    ArenaScope & operator=(ArenaScope const &) = delete;
+
+private:
+    Arena *previous;
+};
+
+/*
+ * Rewinds the active arena, if any, to where it was when the checkpoint was created
+ */
+class ArenaCheckpoint {
+public:
+    ArenaCheckpoint() : arena(Arena::active()), mark(arena ? arena->mark() : Arena::Mark{0, 0}) {}
+    ~ArenaCheckpoint() {
+        if (arena) {
+            arena->rewind(mark);
+        }
+    }
+    ArenaCheckpoint(ArenaCheckpoint const &) = delete;
+    ArenaCheckpoint & operator=(ArenaCheckpoint const &) = delete;
+
+private:
+    Arena *arena;
+    Arena::Mark mark;
+};
+
+/*
+ * Allocates from the arena that was active when the allocator was created, or from the heap if there was none.
+ * Containers keep their allocator when assigned to, so a container created outside an arena stays on the heap
+ */
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    static constexpr size_t alignment = CACHE_LINE;
+    static constexpr bool pad_layers = false;
+
+    Arena *arena;
+
+    ArenaAllocator() : arena(Arena::active()) {}
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        if (arena) {
+            return static_cast<T *>(arena->allocate(n * sizeof(T)));
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(CACHE_LINE)));
+    }
+
+    void deallocate(T *p, size_t) {
+        if (!arena) {
+            ::operator delete(p, std::align_val_t(CACHE_LINE));
+        }
+    }
+
+    template <typename U>
+    bool operator==(ArenaAllocator<U> const &other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(ArenaAllocator<U> const &other) const { return arena != other.arena; }
+};
+
+// -----------------------------------------------------------------------
+// ------------------------------ HUGE PAGES -----------------------------
+// -----------------------------------------------------------------------
+
+static constexpr size_t HUGE_PAGE = 2 << 20;
+
+/*
+ * Allocates straight from mmap, asking for 2MB huge pages. Falls back to transparent huge pages
+ * if none are reserved, meant for large long lived arrays such as the dataset
+ */
+template <typename T>
+struct HugePageAllocator {
+    using value_type = T;
+    static constexpr size_t alignment = CACHE_LINE;
+    static constexpr bool pad_layers = false;
+
+    HugePageAllocator() = default;
+    template <typename U>
+    HugePageAllocator(HugePageAllocator<U> const &) {}
+
+    T *allocate(size_t n) {
+        size_t bytes = round_up(n * sizeof(T), HUGE_PAGE);
+        void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t n) {
+        munmap(p, round_up(n * sizeof(T), HUGE_PAGE));
+    }
+
+    bool operator==(HugePageAllocator const &) const { return true; }
+    bool operator!=(HugePageAllocator const &) const { return false; }
+};
+
+/*
+ * Number of elements between the starts of two layers of the given size, padded if the allocator asks for it
+ */
+template <typename Alloc>
+static constexpr size_t layer_stride(size_t layer) {
+    if constexpr (requires { Alloc::pad_layers; }) {
+        if (Alloc::pad_layers) {
+            return round_up(layer, Alloc::alignment / sizeof(typename Alloc::value_type));
+        }
+    }
+    return layer;
+}
+
+
+#endif //FILTER_FINDER_ALLOCATORS_H
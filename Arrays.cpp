@@ -1,5 +1,6 @@
 #include "Arrays.h"
 
+#include <algorithm>
 #include <utility>
 
 
@@ -7,9 +8,9 @@
 // ---------------------------- SQUARE ARRAYS ----------------------------
 // -----------------------------------------------------------------------
 
-template <typename T>
-SquareArray<T>::SquareArray(std::vector<T> x) {
-    arr = x;
+template <typename T, typename Alloc>
+SquareArray<T, Alloc>::SquareArray(std::vector<T> x) {
+    arr.assign(x.begin(), x.end());
     // TODO Find a less primitive solution
     nrows = std::sqrt(x.size());
     ncols = std::sqrt(x.size());
@@ -17,15 +18,15 @@ SquareArray<T>::SquareArray(std::vector<T> x) {
 
 
 /*
-template <typename T>
-std::vector<T> SquareArray<T>::operator[](size_t i) {
+template <typename T, typename Alloc>
+std::vector<T> SquareArray<T, Alloc>::operator[](size_t i) {
     return std::vector<T>(arr.begin() + nrows * i, arr.begin() + nrows * i + ncols);
 }
  */
 
 // TODO Might need to directly reference the actual vector?
-template <typename T>
-std::vector<T> & SquareArray<T>::operator[](size_t i) {
+template <typename T, typename Alloc>
+std::vector<T> & SquareArray<T, Alloc>::operator[](size_t i) {
     auto *temp = new std::vector<T>();
     temp->reserve(ncols);
     for(size_t j = 0; j < ncols; j++){
@@ -34,8 +35,8 @@ std::vector<T> & SquareArray<T>::operator[](size_t i) {
     return *temp;
 }
 
-template <typename T>
-std::vector<T> SquareArray<T>::operator[](size_t i) const {
+template <typename T, typename Alloc>
+std::vector<T> SquareArray<T, Alloc>::operator[](size_t i) const {
     std::vector<T> temp;
     temp.reserve(ncols);
     for(size_t j = 0; j < ncols; j++){
@@ -44,8 +45,8 @@ std::vector<T> SquareArray<T>::operator[](size_t i) const {
     return temp;
 }
 
-template <typename T>
-SquareArray<T> operator*(T x, SquareArray<T> y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> operator*(T x, SquareArray<T, Alloc> y) {
     for (auto &val : y) {
         val *= x;
     }
@@ -53,8 +54,8 @@ SquareArray<T> operator*(T x, SquareArray<T> y) {
 }
 
 // TODO Change parameter type from 2D to 1D vector, change references to method
-template <typename T>
-SquareArray<T> SquareArray<T>::operator-(std::vector<std::vector<T>> const &y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator-(std::vector<std::vector<T>> const &y) {
     for (size_t i = 0; i < ncols; ++i) {
         for (size_t j = 0; j < nrows; ++j) {
             (*this).arr[index(i, j)] = (*this).arr[index(i, j)] - y[i][j];
@@ -63,9 +64,9 @@ SquareArray<T> SquareArray<T>::operator-(std::vector<std::vector<T>> const &y) {
     return *this;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator-(SquareArray<T> const &y) {
-    SquareArray<T> temp (ncols, nrows);
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator-(SquareArray<T, Alloc> const &y) {
+    SquareArray<T, Alloc> temp (ncols, nrows);
     temp.arr.reserve(arr.size());
     for (size_t i = 0; i < arr.size(); ++i) {
         temp.arr.emplace_back(arr[i] - y.arr[i]);
@@ -73,9 +74,9 @@ SquareArray<T> SquareArray<T>::operator-(SquareArray<T> const &y) {
     return temp;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator-(SquareArray<T> const &y) const {
-    SquareArray<T> temp (ncols, nrows);
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator-(SquareArray<T, Alloc> const &y) const {
+    SquareArray<T, Alloc> temp (ncols, nrows);
     temp.arr.reserve(arr.size());
     for (size_t i = 0; i < arr.size(); ++i) {
         temp.arr.emplace_back(arr[i] - y.arr[i]);
@@ -83,40 +84,40 @@ SquareArray<T> SquareArray<T>::operator-(SquareArray<T> const &y) const {
     return temp;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator+=(SquareArray<T> const &y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator+=(SquareArray<T, Alloc> const &y) {
     for (size_t i = 0; i < arr.size(); ++i) {
         arr[i] += y.arr[i];
     }
     return *this;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator-=(SquareArray<T> const &y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator-=(SquareArray<T, Alloc> const &y) {
     for (size_t i = 0; i < arr.size(); ++i) {
         arr[i] -= y.arr[i];
     }
     return *this;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator+(T y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator+(T y) {
     for(T & val : arr){
         val += y;
     }
     return *this;
 }
 
-template <typename T>
-SquareArray<T> SquareArray<T>::operator*(T y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::operator*(T y) {
     for(T & val : arr){
         val *= y;
     }
     return *this;
 }
 
-template <typename T>
-void SquareArray<T>::flat(std::vector<float> &out) {
+template <typename T, typename Alloc>
+void SquareArray<T, Alloc>::flat(std::vector<float> &out) {
     for (size_t i = 0; i < nrows; i++){
         for (size_t j = 0; j < ncols; j++){
             out[index(i, j)] = arr[index(i, j)];
@@ -124,16 +125,16 @@ void SquareArray<T>::flat(std::vector<float> &out) {
     }
 }
 
-template <typename T>
-SquareArray<T> operator+(T x, SquareArray<T> y) {
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> operator+(T x, SquareArray<T, Alloc> y) {
     for (auto & val : y){
         val += x;
     }
     return y;
 }
 
-template <typename T>
-std::vector<std::vector<T>> SquareArray<T>::get_slices(size_t outer_from, size_t outer_to, size_t inner_from, size_t inner_to) {
+template <typename T, typename Alloc>
+std::vector<std::vector<T>> SquareArray<T, Alloc>::get_slices(size_t outer_from, size_t outer_to, size_t inner_from, size_t inner_to) {
     std::vector<std::vector<T>> ans;
     ans.reserve((outer_to - outer_from) * (inner_to - inner_from));
     for (size_t i = outer_from; i < outer_to; ++i) {
@@ -146,23 +147,84 @@ std::vector<std::vector<T>> SquareArray<T>::get_slices(size_t outer_from, size_t
     return ans;
 }
 
-template <typename T>
-size_t SquareArray<T>::size() const {
+/*
+ * Weights of every input pixel in each output pixel when shrinking n pixels to res by averaging
+ * @return (res, n) matrix, each row sums to 1
+ */
+static std::vector<double, ArenaAllocator<double>> area_weights(size_t n, size_t res) {
+    std::vector<double, ArenaAllocator<double>> weights(res * n, 0.0);
+    double scale = (double) n / (double) res;
+    for (size_t o = 0; o < res; ++o) {
+        double from = o * scale, to = (o + 1) * scale;
+        for (size_t i = (size_t) from; i < n && (double) i < to; ++i) {
+            weights[o * n + i] = (std::min(to, i + 1.0) - std::max(from, (double) i)) / scale;
+        }
+    }
+    return weights;
+}
+
+/*
+ * Weights of every input pixel in each output pixel when growing n pixels to res by linear interpolation.
+ * Like area_weights, pixels are treated as areas and sampled at their centers, so that growing and then
+ * shrinking again keeps the image in place; positions beyond the outer centers take the edge pixel
+ * @return (res, n) matrix, each row sums to 1
+ */
+static std::vector<double, ArenaAllocator<double>> linear_weights(size_t n, size_t res) {
+    std::vector<double, ArenaAllocator<double>> weights(res * n, 0.0);
+    for (size_t o = 0; o < res; ++o) {
+        double pos = std::clamp((o + 0.5) * (double) n / (double) res - 0.5, 0.0, (double) (n - 1));
+        auto i = std::min((size_t) pos, n - 1);
+        double frac = pos - i;
+        weights[o * n + i] += 1 - frac;
+        if (frac > 0) {
+            weights[o * n + i + 1] += frac;
+        }
+    }
+    return weights;
+}
+
+/*
+ * Resamples the array to res x res, averaging when shrinking and interpolating bilinearly when growing
+ * @param res new number of rows and columns
+ */
+template <typename T, typename Alloc>
+SquareArray<T, Alloc> SquareArray<T, Alloc>::resized(size_t res) const {
+    auto wy = res < nrows ? area_weights(nrows, res) : linear_weights(nrows, res);
+    auto wx = res < ncols ? area_weights(ncols, res) : linear_weights(ncols, res);
+
+    SquareArray<T, Alloc> temp(res, res);
+    temp.arr.reserve(res * res);
+    for (size_t i = 0; i < res; ++i) {
+        for (size_t j = 0; j < res; ++j) {
+            double sum = 0;
+            for (size_t y = 0; y < nrows; ++y) {
+                for (size_t x = 0; x < ncols; ++x) {
+                    sum += wy[i * nrows + y] * wx[j * ncols + x] * arr[index(y, x)];
+                }
+            }
+            temp.arr.emplace_back(sum);
+        }
+    }
+    return temp;
+}
+
+template <typename T, typename Alloc>
+size_t SquareArray<T, Alloc>::size() const {
     return nrows;
 }
 
-template <typename T>
-size_t SquareArray<T>::length() const {
+template <typename T, typename Alloc>
+size_t SquareArray<T, Alloc>::length() const {
     return arr.size();
 }
 
-template <typename T>
-size_t SquareArray<T>::index(size_t x, size_t y) const {
+template <typename T, typename Alloc>
+size_t SquareArray<T, Alloc>::index(size_t x, size_t y) const {
     return (x * nrows) + y;
 }
 
-template <typename T>
-void SquareArray<T>::print() const {
+template <typename T, typename Alloc>
+void SquareArray<T, Alloc>::print() const {
     size_t counter = 0;
     for(const auto& value : arr){
         std::cout << value << " ";
@@ -186,14 +248,16 @@ void SquareArray<T>::print() const {
 
 
 
-template <typename T>
-CubeArray<T>::CubeArray(bool zero, size_t outer, size_t middle, size_t inner) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc>::CubeArray(bool zero, size_t outer, size_t middle, size_t inner) {
     nlays = outer;
     nrows = middle;
     ncols = inner;
-    cube.reserve(outer*middle*inner);
-    for (size_t i = 0; i < outer*middle*inner; ++i){
-        if(zero){
+    stride = layer_stride<Alloc>(middle*inner);
+    cube.reserve(outer*stride);
+    for (size_t i = 0; i < outer*stride; ++i){
+        // padding between layers is always 0
+        if(zero || i % stride >= middle*inner){
             cube.emplace_back(0);
         } else {
             cube.emplace_back(get_rand());
@@ -201,24 +265,26 @@ CubeArray<T>::CubeArray(bool zero, size_t outer, size_t middle, size_t inner) {
     }
 }
 
-template <typename T>
-CubeArray<T>::CubeArray(std::vector<std::vector<std::vector<T>>> const &cube_) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc>::CubeArray(std::vector<std::vector<std::vector<T>>> const &cube_) {
     nlays = cube_.size();
     nrows = cube_[0].size();
     ncols = cube_[0][0].size();
-    cube.reserve(cube_.size() * cube_[0].size() * cube_[0].size());
+    stride = layer_stride<Alloc>(nrows * ncols);
+    cube.reserve(nlays * stride);
     for (auto & layer : cube_) {
         for (auto & row : layer) {
             for (auto & col : row) {
                 cube.emplace_back(col);
             }
         }
+        cube.resize(cube.size() + stride - nrows * ncols, 0);
     }
 }
 
 
-template <typename T>
-double CubeArray<T>::calc(SquareArray<T> const &x, size_t outer) {
+template <typename T, typename Alloc>
+double CubeArray<T, Alloc>::calc(SquareArray<T> const &x, size_t outer) {
     double sum = 0;
     for (size_t row = 0; row < nrows; row++) {
         for (size_t value = 0; value < ncols; value++) {
@@ -228,26 +294,26 @@ double CubeArray<T>::calc(SquareArray<T> const &x, size_t outer) {
     return -sum;
 }
 
-template <typename T>
-SquareArray<T> CubeArray<T>::operator[](size_t i) const {
+template <typename T, typename Alloc>
+SquareArray<T> CubeArray<T, Alloc>::operator[](size_t i) const {
     SquareArray<T> temp(nrows, ncols);
     temp.arr.reserve(nrows*ncols);
     for(size_t j = 0; j < nrows * ncols; ++j){
-        temp.arr.emplace_back(cube[i*nrows*ncols + j]);
+        temp.arr.emplace_back(cube[i*stride + j]);
     }
     return temp;
 }
 
-template <typename T>
-CubeArray<T> operator*(T y, CubeArray<T> x) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc> operator*(T y, CubeArray<T, Alloc> x) {
     for(auto & val : x.cube){
         val *= y;
     }
     return x;
 }
 
-template <typename T>
-CubeArray<T> CubeArray<T>::operator/(T y) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc> CubeArray<T, Alloc>::operator/(T y) {
     auto x = *this;
     for (auto & val : x.cube) {
         val /= y;
@@ -255,8 +321,8 @@ CubeArray<T> CubeArray<T>::operator/(T y) {
     return x;
 }
 
-template <typename T>
-CubeArray<T> CubeArray<T>::operator*(T y) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc> CubeArray<T, Alloc>::operator*(T y) {
     auto x = *this;
     for (auto & val : x.cube) {
         val *= y;
@@ -264,63 +330,71 @@ CubeArray<T> CubeArray<T>::operator*(T y) {
     return x;
 }
 
-template <typename T>
-CubeArray<T> CubeArray<T>::operator+=(CubeArray<T> const &y) {
+template <typename T, typename Alloc>
+CubeArray<T, Alloc> CubeArray<T, Alloc>::operator+=(CubeArray<T, Alloc> const &y) {
     for (size_t i = 0; i < length(); i++){
         cube[i] += y.cube[i];
     }
     return *this;
 }
 
-template <typename T>
-size_t CubeArray<T>::size() {
+template <typename T, typename Alloc>
+size_t CubeArray<T, Alloc>::size() {
     return nlays;
 }
 
-template <typename T>
-size_t CubeArray<T>::length() {
+template <typename T, typename Alloc>
+size_t CubeArray<T, Alloc>::length() {
     return cube.size();
 }
 
-template <typename T>
-size_t CubeArray<T>::index(size_t x, size_t y, size_t z){
-    return (x * nrows * ncols) + (y * nrows) + z;
+template <typename T, typename Alloc>
+size_t CubeArray<T, Alloc>::index(size_t x, size_t y, size_t z){
+    return (x * stride) + (y * ncols) + z;
 }
 
-template <typename T>
-void CubeArray<T>::print() const {
-    size_t counter = 0;
-    size_t rows = 1;
-    for(auto & val : cube){
-        std::cout << val << " ";
-        counter++;
-        if (counter % ncols == 0){
-            std::cout << std::endl;
-            rows++;
-        }
-        if (rows % (nrows+1) == 0){
+template <typename T, typename Alloc>
+void CubeArray<T, Alloc>::print() const {
+    for (size_t layer = 0; layer < nlays; layer++){
+        for (size_t row = 0; row < nrows; row++){
+            for (size_t col = 0; col < ncols; col++){
+                std::cout << cube[layer * stride + row * ncols + col] << " ";
+            }
             std::cout << std::endl;
-            counter = 0;
-            rows = 1;
         }
+        std::cout << std::endl;
     }
 }
 
-template <typename T>
-void CubeArray<T>::minus_index(size_t index_, SquareArray<T> const &y) {
+template <typename T, typename Alloc>
+void CubeArray<T, Alloc>::minus_index(size_t index_, SquareArray<T> const &y) {
     for (size_t i = 0; i < y.ncols * y.nrows; ++i) {
-        cube[index_ * nrows * ncols + i] -= y.arr[i];
+        cube[index_ * stride + i] -= y.arr[i];
     }
 }
 
-template <typename T>
-void CubeArray<T>::plus_index(size_t index_, SquareArray<T> const &y) {
+template <typename T, typename Alloc>
+void CubeArray<T, Alloc>::plus_index(size_t index_, SquareArray<T> const &y) {
     for (size_t i = 0; i < y.ncols * y.nrows; ++i) {
-        cube[index_ * nrows * ncols + i] += y.arr[i];
+        cube[index_ * stride + i] += y.arr[i];
     }
 }
 
+template <typename T, typename Alloc>
+void CubeArray<T, Alloc>::set_index(size_t index_, SquareArray<T> const &y) {
+    std::copy(y.arr.begin(), y.arr.end(), cube.begin() + index_ * stride);
+}
+
+template <typename T, typename Alloc>
+void CubeArray<T, Alloc>::swap_index(size_t a, size_t b) {
+    std::swap_ranges(cube.begin() + a * stride, cube.begin() + a * stride + nrows * ncols, cube.begin() + b * stride);
+}
+
 template class SquareArray<double>;
 template class SquareArray<int>;
 template class CubeArray<double>;
 template class CubeArray<int>;
+template class CubeArray<double, AlignedAllocator<double, CACHE_LINE, true>>;
+template class CubeArray<int, AlignedAllocator<int, CACHE_LINE, true>>;
+template class CubeArray<double, ArenaAllocator<double>>;
+template class CubeArray<double, HugePageAllocator<double>>;
@@ -7,13 +7,18 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include "Allocators.h"
 #include "Util.cpp"
 
 
-template <typename T>
+/*
+ * A single patch or filter. These are mostly short lived temporaries, so by default they live in the
+ * active Arena, or on the heap if there is none
+ */
+template <typename T, typename Alloc = ArenaAllocator<T>>
 class SquareArray {
 public:
-    std::vector<T> arr;
+    std::vector<T, Alloc> arr;
     size_t nrows;
     size_t ncols;
 
@@ -22,21 +27,22 @@ public:
 
     void flat(std::vector<float> &out);
     std::vector<std::vector<T>> get_slices(size_t outer_from, size_t outer_to, size_t inner_from, size_t inner_to);
+    SquareArray<T, Alloc> resized(size_t res) const;
     template<T>
-    friend SquareArray<T> operator+(T x, SquareArray<T> y);
+    friend SquareArray<T, Alloc> operator+(T x, SquareArray<T, Alloc> y);
     template<T>
-    friend SquareArray<T> operator*(T x, SquareArray<T> y);
+    friend SquareArray<T, Alloc> operator*(T x, SquareArray<T, Alloc> y);
     std::vector<T> operator[](size_t i) const;
     std::vector<T> & operator[](size_t i);
 
-    SquareArray<T> operator*(T y);
-    SquareArray<T> operator-(SquareArray<T> const &x);
-    SquareArray<T> operator-(SquareArray<T> const &x) const;
-    SquareArray<T> operator-(std::vector<std::vector<T>> const &y);
-    SquareArray<T> operator+(T x);
+    SquareArray<T, Alloc> operator*(T y);
+    SquareArray<T, Alloc> operator-(SquareArray<T, Alloc> const &x);
+    SquareArray<T, Alloc> operator-(SquareArray<T, Alloc> const &x) const;
+    SquareArray<T, Alloc> operator-(std::vector<std::vector<T>> const &y);
+    SquareArray<T, Alloc> operator+(T x);
 
-    SquareArray<T> operator+=(SquareArray<T> const &y);
-    SquareArray<T> operator-=(SquareArray<T> const &y);
+    SquareArray<T, Alloc> operator+=(SquareArray<T, Alloc> const &y);
+    SquareArray<T, Alloc> operator-=(SquareArray<T, Alloc> const &y);
 
 
     size_t size() const;
@@ -45,29 +51,42 @@ public:
     void print() const;
 };
 
-template <typename T>
+/*
+ * A stack of equally sized layers. Alloc decides where cube lives, and whether each layer is padded so that
+ * it starts on its own cache line; stride is the distance between the starts of two layers
+ */
+template <typename T, typename Alloc = std::allocator<T>>
 class CubeArray {
 public:
-    std::vector<T> cube;
+    std::vector<T, Alloc> cube;
     size_t nlays;
     size_t nrows;
     size_t ncols;
+    size_t stride;
 
     CubeArray(bool zero, size_t outer, size_t middle, size_t inner);
     explicit CubeArray(std::vector<std::vector<std::vector<T>>> const &cube_);
+    template <typename A2>
+    explicit CubeArray(CubeArray<T, A2> const &other) : CubeArray(true, other.nlays, other.nrows, other.ncols) {
+        for (size_t i = 0; i < nlays; ++i) {
+            std::copy(other.cube.begin() + i * other.stride, other.cube.begin() + i * other.stride + nrows * ncols, cube.begin() + i * stride);
+        }
+    }
 
     double calc(SquareArray<T> const &x, size_t outer);
     void minus_index(size_t index, SquareArray<T> const &y);
     void plus_index(size_t index,  SquareArray<T> const &y);
+    void set_index(size_t index, SquareArray<T> const &y);
+    void swap_index(size_t a, size_t b);
     SquareArray<T> operator[](size_t i) const; //
 
-    CubeArray<T> operator/(T y);
-    CubeArray<T> operator*(T y);
+    CubeArray<T, Alloc> operator/(T y);
+    CubeArray<T, Alloc> operator*(T y);
 
-    CubeArray<T> operator+=(CubeArray<T> const &y);
+    CubeArray<T, Alloc> operator+=(CubeArray<T, Alloc> const &y);
 
     template<T>
-    friend CubeArray<T> operator*(T y, CubeArray<T> x);
+    friend CubeArray<T, Alloc> operator*(T y, CubeArray<T, Alloc> x);
 
     size_t size();
     size_t length();
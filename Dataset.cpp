@@ -0,0 +1,88 @@
+#include "Dataset.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+
+/*
+ * Reads one big endian 32 bit integer from an idx header
+ */
+static uint32_t read_header_field(std::ifstream &f) {
+    unsigned char bytes[4];
+    if (!f.read(reinterpret_cast<char *>(bytes), 4)) {
+        throw std::runtime_error("idx header is truncated");
+    }
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | (uint32_t) bytes[3];
+}
+
+/*
+ * Reads images from a binary idx file such as MNIST's, the number of images and their size are taken from its header
+ * @param path location of f.ex. train-images-idx3-ubyte, which has to exist
+ * @return an array filled with the pixel data of handwritten numbers
+ * @throws std::runtime_error if the file is not an idx file of unsigned bytes or is shorter than its header says
+ */
+Images read_data(std::string const &path) {
+    std::ifstream f(path, std::ios::binary | std::ios::in);
+
+    // magic number 0x00000803: unsigned bytes, 3 dimensions
+    if (read_header_field(f) != 0x803) {
+        throw std::runtime_error(path + " is not an idx file of 3 dimensional unsigned byte data");
+    }
+    size_t count = read_header_field(f);
+    size_t rows = read_header_field(f);
+    size_t cols = read_header_field(f);
+    if (count == 0 || rows == 0 || cols == 0) {
+        throw std::runtime_error(path + " contains no images");
+    }
+
+    Images images(true, count, rows, cols);
+    std::vector<unsigned char> pixels(rows * cols);
+    for (size_t i = 0; i < count; ++i) {
+        if (!f.read(reinterpret_cast<char *>(pixels.data()), (std::streamsize) pixels.size())) {
+            throw std::runtime_error(path + " ends after " + std::to_string(i) + " of " + std::to_string(count) + " images");
+        }
+        std::transform(pixels.begin(), pixels.end(), images.cube.begin() + i * images.stride,
+                       [](unsigned char c) { return ((double) c) / 255.0; });
+    }
+    std::cout << "number of pictures: " << count << std::endl;
+    return images;
+}
+
+/*
+ * Used to get some number of patches that each represent a random part of one of the images from the dataset
+ * @param data images to sample from, f.ex. from read_data, each at least lower_res + upper_res pixels wide and high
+ * @param batch_size the number of patches to get
+ * @param lower_res number of pixels above and to the left of each patch's center
+ * @param upper_res number of pixels below and to the right of each patch's center, including the center
+ * @return a (batch_size, lower_res + upper_res, lower_res + upper_res) array of samples/patches
+ */
+Batch sample_batch(Images const &data, size_t batch_size, size_t lower_res, size_t upper_res){
+    std::vector<std::array<size_t, 3>, ArenaAllocator<std::array<size_t, 3>>> batch_indices(batch_size);
+    for(size_t i = 0; i < batch_size; ++i) {
+        batch_indices[i][0] = ((int)((get_rand() * (double) data.nlays)));
+        batch_indices[i][1] = ((int)((lower_res + get_rand() * (double) (data.nrows - 2*lower_res))));
+        batch_indices[i][2] = ((int)((lower_res + get_rand() * (double) (data.ncols - 2*lower_res))));
+    }
+
+    size_t res = lower_res + upper_res;
+    Batch batch(true, batch_size, res, res);
+
+    // copy each patch's rows straight out of the image
+    for (size_t i = 0; i < batch_indices.size(); ++i) {
+        for (size_t row = 0; row < res; ++row) {
+            auto from = data.cube.begin() + batch_indices[i][0] * data.stride + (batch_indices[i][1] - lower_res + row) * data.ncols + batch_indices[i][2] - lower_res;
+            std::copy(from, from + res, batch.cube.begin() + i * batch.stride + row * res);
+        }
+    }
+
+    return batch;
+}
+
+/*
+ * Reseeds the generator used by sample_batch, f.ex. so that forked workers don't draw the same patches
+ */
+void seed_batches(unsigned int seed) {
+    mt.seed(seed);
+}
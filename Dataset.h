@@ -0,0 +1,20 @@
+#ifndef FILTER_FINDER_DATASET_H
+#define FILTER_FINDER_DATASET_H
+
+
+#include <string>
+#include "Arrays.h"
+
+// the dataset is large and lives for the whole run, so it is backed by huge pages where available
+using Images = CubeArray<double, HugePageAllocator<double>>;
+// batches are rebuilt for every batch, so they live in the active Arena
+using Batch = CubeArray<double, ArenaAllocator<double>>;
+
+Images read_data(std::string const &path);
+
+Batch sample_batch(Images const &data, size_t batch_size, size_t lower_res, size_t upper_res);
+
+void seed_batches(unsigned int seed);
+
+
+#endif //FILTER_FINDER_DATASET_H
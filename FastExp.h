@@ -0,0 +1,102 @@
+#ifndef FILTER_FINDER_FASTEXP_H
+#define FILTER_FINDER_FASTEXP_H
+
+
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Accuracy tiers for the exponential used by Model::f
+ *
+ * EXACT    std::exp, one libm call per value
+ * PRECISE  degree 7 polynomial, relative error ~1e-8
+ * FAST     degree 6 polynomial, relative error ~1e-7
+ */
+enum class ExpMode {
+    EXACT,
+    PRECISE,
+    FAST
+};
+
+/*
+ * Arguments below this are clamped before scaling by 2^n so the exponent bits never underflow,
+ * exp(-700) is already far below anything that can change a filter
+ */
+static constexpr double EXP_FLOOR = -700.0;
+
+/*
+ * All ones if x < c and all zeros otherwise, taken from the sign bit of x - c. A plain comparison would leave
+ * control flow in the loop, as without -fno-trapping-math gcc will not turn floating point branches into selects
+ */
+static inline uint64_t below(double x, double c) {
+    return 0 - (std::bit_cast<uint64_t>(x - c) >> 63);
+}
+
+/*
+ * Picks a where mask is set and b elsewhere
+ */
+static inline double blend(uint64_t mask, double a, double b) {
+    return std::bit_cast<double>((std::bit_cast<uint64_t>(a) & mask) | (std::bit_cast<uint64_t>(b) & ~mask));
+}
+
+/*
+ * Evaluates exp(x) for a non-positive x using range reduction x = n*ln(2) + r, |r| <= ln(2)/2,
+ * a truncated Taylor polynomial of the given degree for exp(r) and exponent bit manipulation for 2^n.
+ * n is rounded by adding and subtracting 1.5*2^52, which also leaves n in the low bits of the sum,
+ * so there are no libm calls, int conversions or branches and loops calling it vectorize with plain SSE2
+ */
+template <int degree>
+static inline double exp_poly(double x) {
+    constexpr double log2e = 1.4426950408889634;
+    constexpr double ln2_hi = 6.93145751953125e-1;
+    constexpr double ln2_lo = 1.42860682030941723212e-6;
+    constexpr double shift = 0x1.8p52;
+
+    x = blend(below(x, EXP_FLOOR), EXP_FLOOR, x);
+    double t = x * log2e + shift;
+    double n = t - shift;
+    double r = (x - n * ln2_hi) - n * ln2_lo;
+
+    // Horner evaluation of 1 + r + r^2/2! + ... + r^degree/degree!
+    double p = 1.0;
+    for (int k = degree; k > 0; --k) {
+        p = 1.0 + p * r * (1.0 / k);
+    }
+
+    // the low bits of t hold n, shifting them into the exponent field gives 2^n
+    auto bits = (std::bit_cast<uint64_t>(t) + 1023) << 52;
+    return p * std::bit_cast<double>(bits);
+}
+
+/*
+ * Evaluates exp over a whole row of values in place, writing 0 for every value below cutoff.
+ * The polynomial is evaluated for every value and the cutoff applied afterwards as a select
+ * @param row values to exponentiate, expected to be non-positive
+ * @param n length of row
+ * @param mode accuracy tier to use
+ * @param cutoff values below this are treated as exp(x) = 0
+ */
+static inline void exp_row(double *row, size_t n, ExpMode mode, double cutoff) {
+    switch (mode) {
+        case ExpMode::EXACT:
+            for (size_t i = 0; i < n; ++i) {
+                row[i] = row[i] < cutoff ? 0.0 : std::exp(row[i]);
+            }
+            break;
+        case ExpMode::PRECISE:
+            for (size_t i = 0; i < n; ++i) {
+                row[i] = blend(below(row[i], cutoff), 0.0, exp_poly<7>(row[i]));
+            }
+            break;
+        case ExpMode::FAST:
+            for (size_t i = 0; i < n; ++i) {
+                row[i] = blend(below(row[i], cutoff), 0.0, exp_poly<6>(row[i]));
+            }
+            break;
+    }
+}
+
+
+#endif //FILTER_FINDER_FASTEXP_H
@@ -1,5 +1,6 @@
 #include "Model.h"
 
+#include <algorithm>
 #include <utility>
 #include <fstream>
 #include <iostream>
@@ -19,24 +20,161 @@ std::vector<std::vector<T>> operator-=(std::vector<std::vector<double>> &x, Squa
 }
 
 
+/*
+ * Calculates exp(-|x - w_i|^2 / sigma) for every filter i at once
+ * @param x patch or filter to compare every filter against
+ * @param row output, one value per filter
+ */
 template <typename T>
-double Model<T>::f(int i, SquareArray<T> const &x) {
-    return std::exp(this->w.calc(x, i)/this->sigma);
+void Model<T>::f(SquareArray<T> const &x, std::vector<double> &row) {
+    for (size_t i = 0; i < active; ++i) {
+        row[i] = this->w.calc(x, i)/this->sigma;
+    }
+    exp_row(row.data(), active, exp_mode, exp_cutoff);
 }
 
+/*
+ * Decay of the running mean in activation, roughly the last 1000 samples count
+ */
+static constexpr double ACTIVATION_DECAY = 0.999;
+
 template <typename T>
 void Model<T>::update(SquareArray<T> const &x) {
-    std::fill(diff.cube.begin(), diff.cube.end(), 0);
-    for (size_t i1 = 0; i1 < filters; ++i1) {
-        diff.plus_index(i1, (x - w[i1]) * (f(i1, x)));
+    ArenaCheckpoint checkpoint;
+    // pruned filters sit behind the active ones, so only the first active layers are touched
+    size_t used = active * w.stride;
+    std::fill(diff.cube.begin(), diff.cube.begin() + used, 0);
+    f(x, fx);
 
-        for (size_t i2 = 0; i2 < filters; ++i2) {
-            if (i1 != i2) {
-                diff.minus_index(i1, (w[i2] - w[i1]) * (2.0 * lambda * f(i1, w[i2])));
+    double response = 0;
+    for (size_t i = 0; i < active; ++i) {
+        activation[i] = ACTIVATION_DECAY * activation[i] + (1 - ACTIVATION_DECAY) * fx[i];
+        response = std::max(response, fx[i]);
+    }
+    // remember the patch the filters cover worst, it is the best candidate for a respawned filter
+    if (response < worst_response) {
+        worst_response = response;
+        worst.assign(x.arr.begin(), x.arr.end());
+    }
+
+    // the terms are written straight into diff, the only temporary is the copy of w[i1] f compares against,
+    // which is released from the active arena after every filter
+    size_t layer = resolution * resolution;
+    for (size_t i1 = 0; i1 < active; ++i1) {
+        ArenaCheckpoint filter_checkpoint;
+        T *d = diff.cube.data() + i1 * diff.stride;
+        T const *w1 = w.cube.data() + i1 * w.stride;
+        for (size_t k = 0; k < layer; ++k) {
+            d[k] += (x.arr[k] - w1[k]) * fx[i1];
+        }
+
+        // the distance is symmetric, so fw[i2] is the repulsion between i1 and i2
+        f(w[i1], fw);
+        for (size_t i2 = 0; i2 < active; ++i2) {
+            if (i1 != i2 && fw[i2] != 0) {
+                T const *w2 = w.cube.data() + i2 * w.stride;
+                T c = 2.0 * lambda * fw[i2];
+                for (size_t k = 0; k < layer; ++k) {
+                    d[k] -= (w2[k] - w1[k]) * c;
+                }
             }
         }
     }
-    w += ((diff * learning_rate) / sigma);
+    for (size_t i = 0; i < used; ++i) {
+        w.cube[i] += (diff.cube[i] * (T) learning_rate) / (T) sigma;
+    }
+}
+
+/*
+ * Moves filters that no longer respond to the data, or that duplicate another filter, out of the hot loops
+ * in update by swapping them behind the active ones. Optionally revives one pruned filter from the patch
+ * the remaining filters have covered worst since the previous call.
+ * activation starts at 1 and decays by ACTIVATION_DECAY per sample, so a filter that never responds only falls
+ * below threshold after about ln(threshold) / ln(ACTIVATION_DECAY) samples, ~690 for 0.5, and all such filters
+ * fall below it in the same call. The weakest are pruned first, and never more than leave min_active filters
+ * @param threshold filters whose running mean activation falls below this are pruned
+ * @param min_distance filters closer than this to an earlier filter are pruned
+ * @param respawn whether to revive a pruned filter
+ * @param min_active number of filters that are always kept active
+ * @return the number of filters pruned
+ */
+template <typename T>
+size_t Model<T>::prune(double threshold, double min_distance, bool respawn, size_t min_active) {
+    size_t limit = active > min_active ? active - min_active : 0;
+    size_t pruned = 0;
+    std::vector<char> dead(active, false);
+
+    std::vector<size_t> order(active);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return activation[a] < activation[b]; });
+    for (size_t k = 0; k < active && pruned < limit && activation[order[k]] < threshold; ++k) {
+        dead[order[k]] = true;
+        pruned++;
+    }
+    for (size_t i = 0; i < active && pruned < limit; ++i) {
+        for (size_t j = 0; j < i && !dead[i]; ++j) {
+            ArenaCheckpoint checkpoint;
+            if (!dead[j] && -w.calc(w[j], i) < min_distance * min_distance) {
+                dead[i] = true;
+                pruned++;
+            }
+        }
+    }
+
+    size_t i = 0;
+    while (i < active) {
+        if (dead[i]) {
+            active--;
+            w.swap_index(i, active);
+            std::swap(slot[i], slot[active]);
+            std::swap(activation[i], activation[active]);
+            std::swap(dead[i], dead[active]);
+        } else {
+            i++;
+        }
+    }
+
+    if (respawn && active < filters && worst_response < 1.0) {
+        w.set_index(active, SquareArray<T>(worst));
+        activation[active] = 1.0;
+        active++;
+    }
+    worst_response = 1.0;
+    return pruned;
+}
+
+/*
+ * Puts every filter back at its original grid position, so that w can be plotted or saved as a grid again.
+ * Every filter takes part in training afterwards
+ */
+template <typename T>
+void Model<T>::remap() {
+    for (size_t i = 0; i < filters; ++i) {
+        while (slot[i] != i) {
+            size_t target = slot[i];
+            w.swap_index(i, target);
+            std::swap(slot[i], slot[target]);
+            std::swap(activation[i], activation[target]);
+        }
+    }
+    active = filters;
+}
+
+/*
+ * Changes the resolution of every filter, f.ex. to continue training at a finer resolution
+ * @param resolution_ new number of rows and columns of each filter
+ */
+template <typename T>
+void Model<T>::resample(size_t resolution_) {
+    CubeArray<T, Storage> resampled(true, filters, resolution_, resolution_);
+    for (size_t i = 0; i < filters; ++i) {
+        resampled.set_index(i, w[i].resized(resolution_));
+    }
+    w = std::move(resampled);
+    diff = CubeArray<T, Storage>(true, filters, resolution_, resolution_);
+    resolution = resolution_;
+    worst.clear();
+    worst_response = 1.0;
 }
 
 /*
@@ -72,7 +210,14 @@ void Model<T>::save(const char &subfigure) {
 
     std::cout << "Saving figure" << std::endl;
 
-    for(size_t layer = 0; layer < filters; layer++) {
+    // layers are written in grid order, even if pruning has moved them around
+    std::vector<size_t> layers(filters);
+    for (size_t layer = 0; layer < filters; layer++) {
+        layers[slot[layer]] = layer;
+    }
+
+    for(size_t position = 0; position < filters; position++) {
+        size_t layer = layers[position];
         for (size_t row = 0; row < resolution; row++) {
             auto temp2 = w[layer];
             auto temp = temp2[row];
@@ -95,12 +240,13 @@ static inline void rtrim(std::string &s) {
 }
 
 /*
- * Reads a file and loads numbers into a model's mu
- * @param subfigure char representing the subfigure to load
- * @return true if mu was properly loaded
+ * Reads the numbers of a file saved by Model::save
+ * @param subfigure char representing the subfigure to read
+ * @param values output, every number in the file in order
+ * @param res output, the number of values on each row, which is the resolution the filters were saved at
+ * @return true if the file was found
  */
-template <typename T>
-bool Model<T>::load(const char &subfigure) {
+static bool read_figure(const char &subfigure, std::vector<double> &values, size_t &res) {
     std::string path = "../saved/figure2";
     path.push_back(subfigure);
     path.append(".fig");
@@ -111,26 +257,82 @@ bool Model<T>::load(const char &subfigure) {
     std::ifstream file(path);
 
     std::string line;
-    this->w.cube.clear();
-
-    std::vector<T> inner = {};
+    res = 0;
 
     while (std::getline(file, line)) {
         rtrim(line);
         // TODO The following line may or may not need to be active, depending on system locale \
             If filter plots are empty, try (un)commenting it.
         //std::replace(line.begin(), line.end(), '.', ',');
+        size_t before = values.size();
         size_t last = 0, next;
         while ((next = line.find(DELIMITER, last)) != std::string::npos) {
-            inner.emplace_back(std::stod(line.substr(last, next-last)));
+            values.emplace_back(std::stod(line.substr(last, next-last)));
             last = next + 1;
         }
         if(!line.substr(last).empty()){
-            inner.emplace_back(std::stod(line.substr(last)));
+            values.emplace_back(std::stod(line.substr(last)));
+        }
+        if (res == 0) {
+            res = values.size() - before;
         }
     }
+    return true;
+}
+
+/*
+ * Reads a file and loads numbers into a model's mu
+ * @param subfigure char representing the subfigure to load
+ * @return true if mu was properly loaded
+ */
+template <typename T>
+bool Model<T>::load(const char &subfigure) {
+    std::vector<double> inner = {};
+    size_t res;
+    if (!read_figure(subfigure, inner, res)) {
+        return false;
+    }
+
+    // w may pad its layers, so they are copied one at a time
+    size_t layer = resolution * resolution;
+    std::fill(w.cube.begin(), w.cube.end(), 0);
+    for (size_t i = 0; i < filters && (i + 1) * layer <= inner.size(); ++i) {
+        std::copy(inner.begin() + i * layer, inner.begin() + (i + 1) * layer, w.cube.begin() + i * w.stride);
+    }
+    // saved figures are always in grid order
+    std::iota(slot.begin(), slot.end(), 0);
+    active = filters;
+    return true;
+}
+
+/*
+ * Initialises the filters from a previously saved filter bank instead of noise. The bank may come from a model
+ * with another grid size or resolution: if it has more filters than this model, evenly spaced ones are picked,
+ * if it has fewer, the remaining filters stay random. Filters at another resolution are resampled
+ * @param subfigure char representing the saved bank to start from
+ * @return true if the bank was found
+ */
+template <typename T>
+bool Model<T>::warm_start(const char &subfigure) {
+    std::vector<double> bank = {};
+    size_t res;
+    if (!read_figure(subfigure, bank, res) || res == 0) {
+        return false;
+    }
+    size_t layer = res * res;
+    size_t banked = bank.size() / layer;
+
+    size_t used = std::min(banked, filters);
+    for (size_t i = 0; i < used; ++i) {
+        size_t from = i * banked / used;
+        SquareArray<T> filter(std::vector<T>(bank.begin() + from * layer, bank.begin() + (from + 1) * layer));
+        w.set_index(i, res == resolution ? filter : filter.resized(resolution));
+    }
 
-    this->w.cube.swap(inner);
+    std::iota(slot.begin(), slot.end(), 0);
+    std::fill(activation.begin(), activation.end(), 1.0);
+    active = filters;
+    std::cout << "Warm started " << used << " of " << filters << " filters from figure " << subfigure << std::endl;
     return true;
 }
 
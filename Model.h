@@ -3,28 +3,51 @@
 
 
 #include <memory>
+#include <numeric>
 #include <string>
 #include "Arrays.h"
+#include "FastExp.h"
 #include <filesystem>
 
 template <typename T>
 class Model {
 public:
+    // w and diff are aligned and padded so that every filter starts on its own cache line
+    using Storage = AlignedAllocator<T, CACHE_LINE, true>;
+
     double sigma;
     double lambda;
     size_t filters;
     size_t resolution;
     double learning_rate;
-    CubeArray<T> w;
-    explicit Model(double sigma_, double lambda_, int grid_size_, int image_res_, double learning_rate_ = 0.1) : sigma(sigma_), lambda(lambda_), filters(grid_size_ * grid_size_), resolution(image_res_), learning_rate(learning_rate_), w(false, grid_size_ * grid_size_, image_res_, image_res_), diff(true, grid_size_ * grid_size_, image_res_, image_res_) {};
+    CubeArray<T, Storage> w;
+    ExpMode exp_mode = ExpMode::EXACT;
+    double exp_cutoff = EXP_FLOOR;
+    // filters in w[0, active) take part in training, the rest have been pruned
+    size_t active;
+    // grid position of every layer in w
+    std::vector<size_t> slot;
+    // running mean of each layer's response to the patches it has seen
+    std::vector<double> activation;
+    explicit Model(double sigma_, double lambda_, int grid_size_, int image_res_, double learning_rate_ = 0.1) : sigma(sigma_), lambda(lambda_), filters(grid_size_ * grid_size_), resolution(image_res_), learning_rate(learning_rate_), w(false, grid_size_ * grid_size_, image_res_, image_res_), active(grid_size_ * grid_size_), slot(grid_size_ * grid_size_), activation(grid_size_ * grid_size_, 1.0), diff(true, grid_size_ * grid_size_, image_res_, image_res_), fx(grid_size_ * grid_size_), fw(grid_size_ * grid_size_) {
+        std::iota(slot.begin(), slot.end(), 0);
+    };
     void update(SquareArray<T> const &x);
+    size_t prune(double threshold, double min_distance, bool respawn, size_t min_active = 1);
+    void remap();
+    void resample(size_t resolution_);
 
     void save(const char &subfigure);
     bool load(const char &subfigure);
+    bool warm_start(const char &subfigure);
 
 private:
-    double f(int i, SquareArray<T> const &x);
-    CubeArray<T> diff;
+    void f(SquareArray<T> const &x, std::vector<double> &row);
+    CubeArray<T, Storage> diff;
+    std::vector<double> fx;
+    std::vector<double> fw;
+    std::vector<T> worst;
+    double worst_response = 1.0;
 };
 
 
@@ -0,0 +1,480 @@
+/*
+ * Python extension module exposing the training core, so that it can be driven from f.ex. a notebook:
+ *
+ * import filter_finder
+ * data = filter_finder.Dataset("trainingdata")
+ * model = filter_finder.Model(1.0, 0.5, 4, 5)
+ * model.update(data.batch(1000, 5))
+ * model.w  # (filters, resolution, resolution) view of the model's filters, no copy
+ */
+
+#define PY_SSIZE_T_CLEAN
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <Python.h>
+#include <numpy/arrayobject.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include "Dataset.h"
+#include "Model.h"
+
+
+// -----------------------------------------------------------------------
+// ------------------------------- HELPERS -------------------------------
+// -----------------------------------------------------------------------
+
+/*
+ * Wraps a CubeArray's storage in a NumPy array without copying, skipping any padding between layers
+ * @param cube array to view
+ * @param base object that keeps cube alive, the array holds a reference to it
+ * @return new reference to a (nlays, nrows, ncols) float64 array, or nullptr with an exception set
+ */
+template <typename Alloc>
+static PyObject *cube_view(CubeArray<double, Alloc> &cube, PyObject *base) {
+    npy_intp dims[3] = {(npy_intp) cube.nlays, (npy_intp) cube.nrows, (npy_intp) cube.ncols};
+    npy_intp strides[3] = {(npy_intp) (cube.stride * sizeof(double)), (npy_intp) (cube.ncols * sizeof(double)), sizeof(double)};
+    PyObject *view = PyArray_New(&PyArray_Type, 3, dims, NPY_DOUBLE, strides, cube.cube.data(), 0, NPY_ARRAY_CARRAY, nullptr);
+    if (view == nullptr) {
+        return nullptr;
+    }
+    Py_INCREF(base);
+    if (PyArray_SetBaseObject((PyArrayObject *) view, base) < 0) {
+        Py_DECREF(view);
+        return nullptr;
+    }
+    return view;
+}
+
+static void free_batch(PyObject *capsule) {
+    delete (Batch *) PyCapsule_GetPointer(capsule, nullptr);
+}
+
+/*
+ * Hands ownership of a heap allocated batch to a NumPy array
+ */
+static PyObject *batch_to_array(Batch *cube) {
+    PyObject *capsule = PyCapsule_New(cube, nullptr, free_batch);
+    if (capsule == nullptr) {
+        delete cube;
+        return nullptr;
+    }
+    PyObject *array = cube_view(*cube, capsule);
+    Py_DECREF(capsule);
+    return array;
+}
+
+/*
+ * Whether patches of the given resolution can be cut from the images
+ */
+static bool fits(Images const &data, Py_ssize_t resolution) {
+    return resolution <= (Py_ssize_t) std::min(data.nrows, data.ncols);
+}
+
+
+// -----------------------------------------------------------------------
+// ------------------------------- DATASET -------------------------------
+// -----------------------------------------------------------------------
+
+typedef struct {
+    PyObject_HEAD
+    Images *data;
+    // set while __init__ reads the file with the GIL released
+    bool busy;
+} DatasetObject;
+
+static int Dataset_init(DatasetObject *self, PyObject *args, PyObject *kwds) {
+    const char *path = "trainingdata";
+    static const char *kwlist[] = {"path", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", const_cast<char **>(kwlist), &path)) {
+        return -1;
+    }
+    // views of the images may be alive, so they can never be replaced
+    if (self->data != nullptr || self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Dataset is already initialized");
+        return -1;
+    }
+    if (!std::filesystem::exists(path)) {
+        PyErr_Format(PyExc_FileNotFoundError, "could not find training data at %s", path);
+        return -1;
+    }
+    Images *data = nullptr;
+    std::string error;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        data = new Images(read_data(path));
+    } catch (std::runtime_error const &e) {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    self->data = data;
+    if (self->data == nullptr) {
+        PyErr_SetString(PyExc_ValueError, error.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Objects made through __new__ alone have nothing to work on, this sets an exception for them
+ */
+static bool Dataset_ready(DatasetObject *self) {
+    if (self->data == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Dataset was not initialized");
+        return false;
+    }
+    return true;
+}
+
+static void Dataset_dealloc(DatasetObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    delete self->data;
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyObject *Dataset_images(DatasetObject *self, void *) {
+    if (!Dataset_ready(self)) {
+        return nullptr;
+    }
+    return cube_view(*self->data, (PyObject *) self);
+}
+
+/*
+ * Dataset.batch(batch_size, resolution) -> (batch_size, resolution, resolution) array of random patches
+ */
+static PyObject *Dataset_batch(DatasetObject *self, PyObject *args) {
+    Py_ssize_t batch_size, resolution;
+    if (!PyArg_ParseTuple(args, "nn", &batch_size, &resolution) || !Dataset_ready(self)) {
+        return nullptr;
+    }
+    if (batch_size <= 0 || resolution <= 0 || !fits(*self->data, resolution)) {
+        PyErr_SetString(PyExc_ValueError, "batch_size and resolution must be positive and fit within an image");
+        return nullptr;
+    }
+    size_t lower_res = resolution / 2;
+    Batch *batch;
+    Py_BEGIN_ALLOW_THREADS
+    // no arena is active here, so the batch is allocated from the heap and can outlive this call
+    batch = new Batch(sample_batch(*self->data, batch_size, lower_res, resolution - lower_res));
+    Py_END_ALLOW_THREADS
+    return batch_to_array(batch);
+}
+
+static PyGetSetDef Dataset_getset[] = {
+    {"images", (getter) Dataset_images, nullptr, "(images, rows, cols) view of the pixel data", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyMethodDef Dataset_methods[] = {
+    {"batch", (PyCFunction) Dataset_batch, METH_VARARGS, "batch(batch_size, resolution) -> array of random patches"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyType_Slot Dataset_slots[] = {
+    {Py_tp_doc, (void *) "Dataset(path='trainingdata') MNIST images read from an idx file"},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {Py_tp_init, (void *) Dataset_init},
+    {Py_tp_dealloc, (void *) Dataset_dealloc},
+    {Py_tp_getset, Dataset_getset},
+    {Py_tp_methods, Dataset_methods},
+    {0, nullptr}
+};
+
+static PyType_Spec Dataset_spec = {
+    "filter_finder.Dataset", sizeof(DatasetObject), 0, Py_TPFLAGS_DEFAULT, Dataset_slots
+};
+
+static PyObject *DatasetType = nullptr;
+
+
+// -----------------------------------------------------------------------
+// -------------------------------- MODEL --------------------------------
+// -----------------------------------------------------------------------
+
+typedef struct {
+    PyObject_HEAD
+    Model<double> *model;
+    // set while update or train runs with the GIL released
+    bool busy;
+} ModelObject;
+
+static int Model_init(ModelObject *self, PyObject *args, PyObject *kwds) {
+    double sigma, lambda_, learning_rate = 0.1, exp_cutoff = EXP_FLOOR;
+    int grid_size, resolution, exp_mode = 0;
+    static const char *kwlist[] = {"sigma", "lambda_", "grid_size", "resolution", "learning_rate", "exp_mode", "exp_cutoff", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ddii|did", const_cast<char **>(kwlist),
+                                     &sigma, &lambda_, &grid_size, &resolution, &learning_rate, &exp_mode, &exp_cutoff)) {
+        return -1;
+    }
+    if (grid_size <= 0 || resolution <= 0 || exp_mode < 0 || exp_mode > (int) ExpMode::FAST) {
+        PyErr_SetString(PyExc_ValueError, "grid_size and resolution must be positive, exp_mode between 0 and 2");
+        return -1;
+    }
+    // views of w may be alive, and update or train may be running on another thread, so the model is never replaced
+    if (self->model != nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Model is already initialized");
+        return -1;
+    }
+    self->model = new Model<double>(sigma, lambda_, grid_size, resolution, learning_rate);
+    self->model->exp_mode = static_cast<ExpMode>(exp_mode);
+    self->model->exp_cutoff = exp_cutoff;
+    return 0;
+}
+
+static void Model_dealloc(ModelObject *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    delete self->model;
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+/*
+ * Objects made through __new__ alone have no model, this sets an exception for them
+ */
+static bool Model_ready(ModelObject *self) {
+    if (self->model == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "Model was not initialized");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Marks the model as in use by a call that releases the GIL, so that no other thread can change it meanwhile.
+ * Sets an exception and returns false if the model is not initialized or already in use
+ */
+static bool Model_acquire(ModelObject *self) {
+    if (!Model_ready(self)) {
+        return false;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Model is busy training on another thread");
+        return false;
+    }
+    self->busy = true;
+    return true;
+}
+
+static PyObject *Model_w(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return cube_view(self->model->w, (PyObject *) self);
+}
+
+/*
+ * Model.update(batch) runs update for every patch of a (n, resolution, resolution) or (resolution, resolution) array
+ */
+static PyObject *Model_update(ModelObject *self, PyObject *args) {
+    PyObject *arg;
+    if (!PyArg_ParseTuple(args, "O", &arg) || !Model_ready(self)) {
+        return nullptr;
+    }
+    auto *batch = (PyArrayObject *) PyArray_FROMANY(arg, NPY_DOUBLE, 2, 3, NPY_ARRAY_IN_ARRAY);
+    if (batch == nullptr) {
+        return nullptr;
+    }
+    int ndim = PyArray_NDIM(batch);
+    npy_intp *dims = PyArray_DIMS(batch);
+    auto res = (npy_intp) self->model->resolution;
+    if (dims[ndim - 1] != res || dims[ndim - 2] != res) {
+        Py_DECREF(batch);
+        PyErr_Format(PyExc_ValueError, "patches must be %zd x %zd", res, res);
+        return nullptr;
+    }
+
+    if (!Model_acquire(self)) {
+        Py_DECREF(batch);
+        return nullptr;
+    }
+    auto *samples = (const double *) PyArray_DATA(batch);
+    size_t nsamples = ndim == 3 ? dims[0] : 1;
+    size_t patch = res * res;
+    Model<double> &model = *self->model;
+    Py_BEGIN_ALLOW_THREADS
+    Arena arena;
+    ArenaScope scope(arena);
+    for (size_t i = 0; i < nsamples; ++i) {
+        ArenaCheckpoint checkpoint;
+        model.update(SquareArray<double>(std::vector<double>(samples + i * patch, samples + (i + 1) * patch)));
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    Py_DECREF(batch);
+    Py_RETURN_NONE;
+}
+
+/*
+ * Model.train(dataset, nbatches, batch_size) samples and trains on batches entirely in C++
+ */
+static PyObject *Model_train(ModelObject *self, PyObject *args) {
+    DatasetObject *dataset;
+    Py_ssize_t nbatches, batch_size;
+    if (!PyArg_ParseTuple(args, "O!nn", (PyTypeObject *) DatasetType, &dataset, &nbatches, &batch_size) ||
+        !Model_ready(self) || !Dataset_ready(dataset)) {
+        return nullptr;
+    }
+    if (nbatches < 0 || batch_size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "nbatches must be non-negative and batch_size positive");
+        return nullptr;
+    }
+    if (!fits(*dataset->data, (Py_ssize_t) self->model->resolution)) {
+        PyErr_SetString(PyExc_ValueError, "the dataset's images are smaller than the model's resolution");
+        return nullptr;
+    }
+    if (!Model_acquire(self)) {
+        return nullptr;
+    }
+    Model<double> &model = *self->model;
+    Images &data = *dataset->data;
+    size_t lower_res = model.resolution / 2;
+    Py_BEGIN_ALLOW_THREADS
+    Arena arena;
+    ArenaScope scope(arena);
+    for (Py_ssize_t i = 0; i < nbatches; ++i) {
+        arena.reset();
+        Batch batch = sample_batch(data, batch_size, lower_res, model.resolution - lower_res);
+        for (Py_ssize_t j = 0; j < batch_size; ++j) {
+            model.update(batch[j]);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    Py_RETURN_NONE;
+}
+
+static PyObject *Model_save(ModelObject *self, PyObject *args) {
+    int subfigure;
+    if (!PyArg_ParseTuple(args, "C", &subfigure) || !Model_acquire(self)) {
+        return nullptr;
+    }
+    self->model->save((char) subfigure);
+    self->busy = false;
+    Py_RETURN_NONE;
+}
+
+static PyObject *Model_load(ModelObject *self, PyObject *args) {
+    int subfigure;
+    if (!PyArg_ParseTuple(args, "C", &subfigure) || !Model_acquire(self)) {
+        return nullptr;
+    }
+    bool found = self->model->load((char) subfigure);
+    self->busy = false;
+    return PyBool_FromLong(found);
+}
+
+static PyObject *Model_sigma(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return PyFloat_FromDouble(self->model->sigma);
+}
+
+static PyObject *Model_lambda(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return PyFloat_FromDouble(self->model->lambda);
+}
+
+static PyObject *Model_filters(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return PyLong_FromSize_t(self->model->filters);
+}
+
+static PyObject *Model_resolution(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return PyLong_FromSize_t(self->model->resolution);
+}
+
+static PyObject *Model_learning_rate(ModelObject *self, void *) {
+    if (!Model_ready(self)) {
+        return nullptr;
+    }
+    return PyFloat_FromDouble(self->model->learning_rate);
+}
+
+static PyGetSetDef Model_getset[] = {
+    {"w", (getter) Model_w, nullptr, "(filters, resolution, resolution) view of the filters, invalidated by load", nullptr},
+    {"sigma", (getter) Model_sigma, nullptr, nullptr, nullptr},
+    {"lambda_", (getter) Model_lambda, nullptr, nullptr, nullptr},
+    {"filters", (getter) Model_filters, nullptr, nullptr, nullptr},
+    {"resolution", (getter) Model_resolution, nullptr, nullptr, nullptr},
+    {"learning_rate", (getter) Model_learning_rate, nullptr, nullptr, nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyMethodDef Model_methods[] = {
+    {"update", (PyCFunction) Model_update, METH_VARARGS, "update(batch) trains on every patch in batch"},
+    {"train", (PyCFunction) Model_train, METH_VARARGS, "train(dataset, nbatches, batch_size) trains on random patches"},
+    {"save", (PyCFunction) Model_save, METH_VARARGS, "save(subfigure) writes the filters to ../saved/figure2<subfigure>.fig"},
+    {"load", (PyCFunction) Model_load, METH_VARARGS, "load(subfigure) reads the filters from ../saved/figure2<subfigure>.fig"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyType_Slot Model_slots[] = {
+    {Py_tp_doc, (void *) "Model(sigma, lambda_, grid_size, resolution, learning_rate=0.1, exp_mode=0, exp_cutoff=-700)"},
+    {Py_tp_new, (void *) PyType_GenericNew},
+    {Py_tp_init, (void *) Model_init},
+    {Py_tp_dealloc, (void *) Model_dealloc},
+    {Py_tp_getset, Model_getset},
+    {Py_tp_methods, Model_methods},
+    {0, nullptr}
+};
+
+static PyType_Spec Model_spec = {
+    "filter_finder.Model", sizeof(ModelObject), 0, Py_TPFLAGS_DEFAULT, Model_slots
+};
+
+
+// -----------------------------------------------------------------------
+// ------------------------------- MODULE --------------------------------
+// -----------------------------------------------------------------------
+
+static PyObject *seed(PyObject *, PyObject *args) {
+    unsigned int value;
+    if (!PyArg_ParseTuple(args, "I", &value)) {
+        return nullptr;
+    }
+    seed_batches(value);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef module_methods[] = {
+    {"seed", seed, METH_VARARGS, "seed(value) reseeds the generator used to sample batches"},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "filter_finder", "Training core of the local learning rule", -1, module_methods,
+    nullptr, nullptr, nullptr, nullptr
+};
+
+PyMODINIT_FUNC PyInit_filter_finder() {
+    import_array();
+
+    PyObject *m = PyModule_Create(&module);
+    if (m == nullptr) {
+        return nullptr;
+    }
+    DatasetType = PyType_FromSpec(&Dataset_spec);
+    PyObject *model_type = PyType_FromSpec(&Model_spec);
+    if (DatasetType == nullptr || model_type == nullptr ||
+        PyModule_AddObjectRef(m, "Dataset", DatasetType) < 0 ||
+        PyModule_AddObjectRef(m, "Model", model_type) < 0) {
+        Py_XDECREF(model_type);
+        Py_DECREF(m);
+        return nullptr;
+    }
+    Py_DECREF(model_type);
+    return m;
+}
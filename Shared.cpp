@@ -0,0 +1,175 @@
+#include "Shared.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/*
+ * Creates the shared segment and fills it with the initial weights. The segment is unlinked as soon as it is
+ * mapped, it stays alive for as long as this process or any of its forked children keep it mapped
+ * @param init initial weights, f.ex. a model's w.cube.data()
+ * @param len_ number of weights, including any padding
+ * @param workers_ number of worker processes that will take part in averaging
+ */
+template <typename T>
+SharedCube<T>::SharedCube(T const *init, size_t len_, size_t workers_) : len(len_), workers(workers_) {
+    bytes = sizeof(SharedHeader) + 2 * len * sizeof(T);
+    std::string name = "/filter_finder_" + std::to_string(getpid());
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1 || ftruncate(fd, (off_t) bytes) == -1) {
+        std::cerr << "could not create shared memory segment " << name << std::endl;
+        exit(1);
+    }
+    segment = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name.c_str());
+    if (segment == MAP_FAILED) {
+        std::cerr << "could not map shared memory segment " << name << std::endl;
+        exit(1);
+    }
+
+    header = new (segment) SharedHeader();
+    w = reinterpret_cast<T *>(header + 1);
+    acc = w + len;
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&header->mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+
+    pthread_barrierattr_t barrier_attr;
+    pthread_barrierattr_init(&barrier_attr);
+    pthread_barrierattr_setpshared(&barrier_attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&header->barrier, &barrier_attr, workers);
+    pthread_barrierattr_destroy(&barrier_attr);
+
+    header->batches = 0;
+    std::copy(init, init + len, w);
+    std::fill(acc, acc + len, 0);
+}
+
+template <typename T>
+SharedCube<T>::~SharedCube() {
+    munmap(segment, bytes);
+}
+
+/*
+ * Hogwild step: adds what a worker has learned since its last exchange to the shared weights without locking,
+ * then refreshes the worker's copy with the result
+ * @param local the worker's current weights
+ * @param base the worker's weights right after its previous exchange
+ */
+template <typename T>
+void SharedCube<T>::exchange(T *local, T *base) {
+    for (size_t i = 0; i < len; ++i) {
+        w[i] += local[i] - base[i];
+        local[i] = w[i];
+        base[i] = w[i];
+    }
+}
+
+/*
+ * Replaces the shared weights with the mean of every worker's weights. Every worker has to call this
+ * the same number of times, as it blocks until all of them have contributed
+ * @param local the worker's current weights, overwritten with the mean
+ */
+template <typename T>
+void SharedCube<T>::average(T *local) {
+    pthread_mutex_lock(&header->mutex);
+    for (size_t i = 0; i < len; ++i) {
+        acc[i] += local[i] / (T) workers;
+    }
+    pthread_mutex_unlock(&header->mutex);
+
+    if (pthread_barrier_wait(&header->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        pthread_mutex_lock(&header->mutex);
+        std::copy(acc, acc + len, w);
+        std::fill(acc, acc + len, 0);
+        pthread_mutex_unlock(&header->mutex);
+    }
+    pthread_barrier_wait(&header->barrier);
+
+    std::copy(w, w + len, local);
+}
+
+/*
+ * Copies the shared weights, used by the coordinator for checkpointing
+ * @param out destination, f.ex. a model's w.cube.data()
+ */
+template <typename T>
+void SharedCube<T>::snapshot(T *out) {
+    pthread_mutex_lock(&header->mutex);
+    std::copy(w, w + len, out);
+    pthread_mutex_unlock(&header->mutex);
+}
+
+template <typename T>
+void SharedCube<T>::finish_batch() {
+    header->batches++;
+}
+
+template <typename T>
+size_t SharedCube<T>::batches() const {
+    return header->batches;
+}
+
+/*
+ * Parses a sysfs cpulist such as "0-3,8-11"
+ */
+static void parse_cpulist(std::string const &list, cpu_set_t &set) {
+    size_t last = 0;
+    while (last < list.size()) {
+        size_t next = list.find(',', last);
+        if (next == std::string::npos) {
+            next = list.size();
+        }
+        std::string range = list.substr(last, next - last);
+        size_t dash = range.find('-');
+        int from = std::stoi(range.substr(0, dash));
+        int to = dash == std::string::npos ? from : std::stoi(range.substr(dash + 1));
+        for (int cpu = from; cpu <= to; ++cpu) {
+            CPU_SET(cpu, &set);
+        }
+        last = next + 1;
+    }
+}
+
+/*
+ * Pins the calling process to the cpus of one NUMA node, workers are spread over the nodes round robin.
+ * Memory the worker touches afterwards is then allocated on that node
+ * @param worker index of the worker
+ * @return true if the process was pinned, false if the system exposes no NUMA information
+ */
+bool pin_to_node(size_t worker) {
+    size_t nodes = 0;
+    while (std::filesystem::exists("/sys/devices/system/node/node" + std::to_string(nodes))) {
+        nodes++;
+    }
+    if (nodes == 0) {
+        return false;
+    }
+
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(worker % nodes) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list) || list.empty()) {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    parse_cpulist(list, set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+template class SharedCube<double>;
+template class SharedCube<int>;
@@ -0,0 +1,51 @@
+#ifndef FILTER_FINDER_SHARED_H
+#define FILTER_FINDER_SHARED_H
+
+
+#include <atomic>
+#include <cstddef>
+#include <pthread.h>
+#include <vector>
+
+/*
+ * Bookkeeping placed at the start of the shared segment, followed by the weights and an accumulator
+ */
+struct SharedHeader {
+    pthread_mutex_t mutex;
+    pthread_barrier_t barrier;
+    std::atomic<size_t> batches;
+};
+
+/*
+ * A model's weights placed in an anonymous POSIX shared memory segment, so that forked
+ * worker processes can train against the same filters
+ */
+template <typename T>
+class SharedCube {
+public:
+    size_t len;
+    size_t workers;
+
+    SharedCube(T const *init, size_t len_, size_t workers_);
+    ~SharedCube();
+    SharedCube(SharedCube const &) = delete;
+    SharedCube & operator=(SharedCube const &) = delete;
+
+    void exchange(T *local, T *base);
+    void average(T *local);
+    void snapshot(T *out);
+    void finish_batch();
+    size_t batches() const;
+
+private:
+    void *segment;
+    size_t bytes;
+    SharedHeader *header;
+    T *w;
+    T *acc;
+};
+
+bool pin_to_node(size_t worker);
+
+
+#endif //FILTER_FINDER_SHARED_H
@@ -3,9 +3,16 @@
 #include <fstream>
 #include <chrono>
 #include <random>
+#include <stdexcept>
+#include <thread>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "Arrays.h"
 #include "Model.h"
+#include "Dataset.h"
+#include "Shared.h"
 #include "dependencies/matplotlib-cpp/matplotlibcpp.h"
 
 namespace plt = matplotlibcpp;
@@ -17,50 +24,38 @@ static int RESOLUTION = 5;
 static int LOWER_RES = 3;
 static int UPPER_RES = 2;
 static size_t BATCH_SIZE = 1000;
+static ExpMode EXP_MODE = ExpMode::EXACT;
+static double EXP_CUTOFF = EXP_FLOOR;
+static size_t WORKERS = 1;
+static size_t SYNC_INTERVAL = 0;
+static size_t CHECKPOINT_INTERVAL = 100;
+static double PRUNE_THRESHOLD = 0;
+static bool RESPAWN = false;
+static double DUPLICATE_DISTANCE = 1e-3;
+// pruning always leaves at least this share of the grid active
+static double MIN_ACTIVE_FRACTION = 0.25;
+static int COARSE_RES = 0;
+static double CONVERGENCE_TOL = 1e-3;
+static char WARM_START = 0;
+static std::string DATA_PATH = "trainingdata";
 
 /*
- * Reads the MNIST dataset from binary file located at "./data/train-images-idx3-ubyte"
+ * Reads the MNIST dataset from binary file, by default the copy of "./data/train-images-idx3-ubyte" CMake places
+ * next to the executable
+ * @param path location of the dataset
  * @return an array filled with the pixel data of handwritten numbers
  */
-CubeArray<double> get_data() {
+Images get_data(std::string const &path) {
     std::cout << "getting data" << std::endl;
 
-    if (std::filesystem::exists("trainingdata")) {
+    if (std::filesystem::exists(path)) {
         std::cout << "found training data" << std::endl;
-
-        std::ifstream f("trainingdata", std::ios::binary | std::ios::in);
-        // ignore until image data
-        f.ignore(16);
-
-        std::vector<std::vector <std::vector<double>>> multi_pic_vector;
-        for(int i = 0; i < 60000; ++i) {
-            std::vector<std::vector<double>> single_pic_vector;
-            single_pic_vector.reserve(28);
-            for(int j = 0; j < 28; ++j) {
-                single_pic_vector.emplace_back(std::vector<double>());
-            }
-            multi_pic_vector.emplace_back(single_pic_vector);
-        }
-
-        char b;
-        unsigned int rowCounter = 0;
-        unsigned int picCounter = 0;
-        unsigned int columnCounter = 0;
-        while (f.get(b)) {
-            auto c = (unsigned char) b;
-            multi_pic_vector[picCounter][rowCounter].emplace_back(((double) c) / 255.0);
-            columnCounter++;
-            if (columnCounter > 27) {
-                rowCounter++;
-                columnCounter = 0;
-                if (rowCounter > 27) {
-                    picCounter++;
-                    rowCounter = 0;
-                }
-            }
+        try {
+            return read_data(path);
+        } catch (std::runtime_error const &e) {
+            std::cerr << "could not read training data: " << e.what() << std::endl;
+            exit(1);
         }
-        std::cout << "number of pictures: " << picCounter << std::endl;
-        return CubeArray<double>(multi_pic_vector);
     }
     else {
         std::cerr << "could not find training data, downloading not yet implemented" << std::endl;
@@ -68,32 +63,16 @@ CubeArray<double> get_data() {
     }
 }
 
-auto data = get_data();
+// loaded in main, once the path is known
+Images data(true, 0, 0, 0);
 
 /*
- * Used to get some number of patches that each represent a random part of one of the 60000 images from the dataset
+ * Used to get some number of patches that each represent a random part of one of the images from the dataset
  * @param batch_size the number of patches to get
  * @return a (batch_size, RESOLUTION, RESOLUTION) array of samples/patches
  */
-template <typename T>
-CubeArray<T> get_batch(size_t batch_size){
-    std::vector<std::vector<size_t>> batch_indices(batch_size, std::vector<size_t>(3));
-    for(size_t i = 0; i < batch_size; ++i) {
-        std::vector<size_t> temp;
-        batch_indices[i][0] = ((int)((get_rand() * 60000.)));
-        // todo hardcoded shapes
-        batch_indices[i][1] = ((int)((LOWER_RES + get_rand() * (28 - 2*LOWER_RES))));
-        batch_indices[i][2] = ((int)((LOWER_RES + get_rand() * (28 - 2*LOWER_RES))));
-    }
-
-    std::vector<std::vector<std::vector<T>>> batch;
-
-    for (size_t i = 0; i < batch_indices.size(); ++i) {
-        auto dt = data[batch_indices[i][0]];
-        batch.emplace_back( dt.get_slices(batch_indices[i][1] - LOWER_RES, batch_indices[i][1] + UPPER_RES, batch_indices[i][2] - LOWER_RES, batch_indices[i][2] + UPPER_RES));
-    }
-
-    return CubeArray<T>(batch);
+Batch get_batch(size_t batch_size){
+    return sample_batch(data, batch_size, LOWER_RES, UPPER_RES);
 }
 
 static std::vector<long> ex_times;
@@ -102,24 +81,221 @@ static std::vector<long> ex_times;
  * The main method used for finding filters
  * @param subfigure char to be used for saving/loading
  * @param nbatches number of batches to run through
+ * @param exp_mode accuracy tier of the exponential used by the model
+ * @param exp_cutoff exponents below this are treated as 0
+ * @param prune_threshold after every batch, filters whose mean activation is below this are pruned, 0 disables pruning.
+ *        At least MIN_ACTIVE_FRACTION of the filters always stay active
+ * @param respawn whether to revive one pruned filter after every batch from the patch the filters cover worst
+ * @param coarse_res if set below RESOLUTION, training starts on patches downsampled to this resolution and moves up
+ *        two pixels at a time whenever the filters converge, 0 trains at RESOLUTION throughout. The squared distances
+ *        in the kernel sum over fewer pixels at coarse levels, so sigma is scaled by the number of pixels at each level
+ * @param warm_start subfigure of previously saved filters to continue training from, 0 starts from random filters
  */
 template <typename T>
-void experiment(const char subfigure, double sigma, double lambda_, size_t nbatches){
+void experiment(const char subfigure, double sigma, double lambda_, size_t nbatches, ExpMode exp_mode = ExpMode::EXACT, double exp_cutoff = EXP_FLOOR, double prune_threshold = 0, bool respawn = false, int coarse_res = 0, char warm_start = 0){
     // TODO Set random seed for consistent experiments
     auto start = std::chrono::steady_clock::now();
-    Model<T> model(sigma, lambda_, GRID_SIZE, RESOLUTION);
+    int level_res = coarse_res > 0 ? std::min(coarse_res, RESOLUTION) : RESOLUTION;
+    auto level_sigma = [&](int res) { return sigma * (res * res) / (RESOLUTION * RESOLUTION); };
+    Model<T> model(level_sigma(level_res), lambda_, GRID_SIZE, level_res);
+    if (warm_start && !model.warm_start(warm_start)) {
+        std::cerr << "could not warm start from figure " << warm_start << std::endl;
+        exit(1);
+    }
+
+    // no level may take more than its share of the batches, so that some are left for the full resolution
+    size_t levels = (RESOLUTION - level_res + 1) / 2 + 1;
+    size_t level_budget = nbatches / levels;
+    size_t level_batches = 0;
+    std::vector<T> previous;
+    model.exp_mode = exp_mode;
+    model.exp_cutoff = exp_cutoff;
+    // batches and temporaries live in the arena, which is emptied before every batch
+    Arena arena;
+    ArenaScope scope(arena);
 
     for (size_t i = 0; i < nbatches; i++){
         auto start = std::chrono::high_resolution_clock::now();
-        CubeArray<T> batch = get_batch<double>(BATCH_SIZE);
-        for (size_t j = 0; j < BATCH_SIZE; j++){
-            model.update(batch[j]);
+        arena.reset();
+        Batch batch = get_batch(BATCH_SIZE);
+        if (level_res < RESOLUTION) {
+            previous.assign(model.w.cube.begin(), model.w.cube.end());
+            for (size_t j = 0; j < BATCH_SIZE; j++){
+                model.update(batch[j].resized(level_res));
+            }
+        } else {
+            for (size_t j = 0; j < BATCH_SIZE; j++){
+                model.update(batch[j]);
+            }
+        }
+        // relative change of the filters over this batch, measured before prune moves layers around
+        double change = 0, total = 0;
+        for (size_t k = 0; k < previous.size(); k++){
+            change += std::abs(model.w.cube[k] - previous[k]);
+            total += std::abs(previous[k]);
+        }
+        if (prune_threshold > 0) {
+            model.prune(prune_threshold, DUPLICATE_DISTANCE, respawn, std::max<size_t>(1, model.filters * MIN_ACTIVE_FRACTION));
+        }
+        if (level_res < RESOLUTION) {
+            if (++level_batches >= level_budget || change < CONVERGENCE_TOL * total) {
+                level_res = std::min(level_res + 2, RESOLUTION);
+                model.resample(level_res);
+                model.sigma = level_sigma(level_res);
+                level_batches = 0;
+                previous.clear();
+                std::cout << subfigure << "-" << "CO3: Moving to resolution " << level_res << std::endl;
+            }
         }
         auto stop = std::chrono::high_resolution_clock::now();
         std::cout << subfigure << "-" << "CO3: Completed batch " << i+1 << " @ " << BATCH_SIZE << " after " <<
         std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count()
-        << "ms" << std::endl;
+        << "ms" << ", " << model.active << " active filters" << std::endl;
+    }
+    // the batches may run out before every level converged, the filters are saved at the full resolution regardless
+    if (level_res < RESOLUTION) {
+        level_res = RESOLUTION;
+        model.resample(level_res);
+        model.sigma = sigma;
+        std::cout << subfigure << "-" << "CO3: Moving to resolution " << level_res << std::endl;
+    }
+    model.remap();
+    auto stop = std::chrono::steady_clock::now();
+    std::clog <<
+    std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "," << model.sigma << ","
+    << model.lambda <<  "," << model.filters << "," << model.resolution <<  "," << BATCH_SIZE << "," << nbatches;
+    std::cout << "Experiment " << subfigure <<" ended after " <<
+              std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
+    ex_times.push_back((stop - start).count());
+    model.save(subfigure);
+}
+
+/*
+ * Training loop of one worker process in shared_experiment, the process exits when it is done
+ * @param shared weights shared by all workers
+ * @param id index of this worker, used to pick a NUMA node
+ * @param nbatches number of batches this worker runs through
+ * @param sync_interval 0 to exchange weights Hogwild style after every sample,
+ *        otherwise the number of batches between each averaging of all workers' weights
+ * @param syncs number of averages every worker takes part in, workers with fewer batches than others
+ *        contribute their final weights to the averages left once they are done
+ */
+template <typename T>
+[[noreturn]] void worker(SharedCube<T> &shared, size_t id, double sigma, double lambda_, size_t nbatches, size_t sync_interval, size_t syncs){
+    pin_to_node(id);
+    // every worker inherits the same generator state from the coordinator
+    seed_batches(rd() + id);
+
+    Model<T> model(sigma, lambda_, GRID_SIZE, RESOLUTION);
+    model.exp_mode = EXP_MODE;
+    model.exp_cutoff = EXP_CUTOFF;
+    shared.snapshot(model.w.cube.data());
+    std::vector<T> base(model.w.cube.begin(), model.w.cube.end());
+    Arena arena;
+    ArenaScope scope(arena);
+    size_t synced = 0;
+
+    for (size_t i = 0; i < nbatches; i++){
+        arena.reset();
+        Batch batch = get_batch(BATCH_SIZE);
+        for (size_t j = 0; j < BATCH_SIZE; j++){
+            model.update(batch[j]);
+            if (sync_interval == 0) {
+                shared.exchange(model.w.cube.data(), base.data());
+            }
+        }
+        if (sync_interval != 0 && ((i + 1) % sync_interval == 0 || i + 1 == nbatches)) {
+            shared.average(model.w.cube.data());
+            synced++;
+        }
+        shared.finish_batch();
     }
+    // the barrier in average waits for every worker, so all of them have to average equally often
+    for (; synced < syncs; synced++) {
+        shared.average(model.w.cube.data());
+    }
+    _exit(0);
+}
+
+/*
+ * Kills and reaps every worker that is still running
+ * @param pids worker pids, 0 for those that have already been reaped
+ */
+static void stop_workers(std::vector<pid_t> const &pids) {
+    for (pid_t pid : pids) {
+        if (pid != 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+}
+
+/*
+ * Runs an experiment with several worker processes training against weights in shared memory, while this process
+ * acts as coordinator and saves a checkpoint every CHECKPOINT_INTERVAL batches
+ * @param subfigure char to be used for saving/loading
+ * @param nbatches number of batches to run through, split between the workers
+ * @param workers number of worker processes, at most one per batch is started
+ * @param sync_interval see worker
+ * @param warm_start see experiment
+ */
+template <typename T>
+void shared_experiment(const char subfigure, double sigma, double lambda_, size_t nbatches, size_t workers, size_t sync_interval, char warm_start = 0){
+    auto start = std::chrono::steady_clock::now();
+    Model<T> model(sigma, lambda_, GRID_SIZE, RESOLUTION);
+    if (warm_start && !model.warm_start(warm_start)) {
+        std::cerr << "could not warm start from figure " << warm_start << std::endl;
+        exit(1);
+    }
+    workers = std::max<size_t>(1, std::min(workers, nbatches));
+    SharedCube<T> shared(model.w.cube.data(), model.w.cube.size(), workers);
+    // the first nbatches % workers workers run one batch more than the rest
+    size_t per_worker = nbatches / workers;
+    size_t most = per_worker + (nbatches % workers != 0);
+    size_t syncs = sync_interval == 0 ? 0 : (most + sync_interval - 1) / sync_interval;
+
+    std::vector<pid_t> pids;
+    for (size_t id = 0; id < workers; id++){
+        pid_t pid = fork();
+        if (pid == 0) {
+            worker(shared, id, sigma, lambda_, per_worker + (id < nbatches % workers), sync_interval, syncs);
+        }
+        if (pid == -1) {
+            std::cerr << "could not start worker " << id << std::endl;
+            stop_workers(pids);
+            exit(1);
+        }
+        pids.push_back(pid);
+    }
+
+    size_t running = workers;
+    size_t checkpoint = CHECKPOINT_INTERVAL;
+    while (running > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (size_t id = 0; id < workers; id++) {
+            int status;
+            if (pids[id] == 0 || waitpid(pids[id], &status, WNOHANG) != pids[id]) {
+                continue;
+            }
+            pids[id] = 0;
+            running--;
+            // the others may be waiting for it in average, and what it trained is lost either way
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                std::cerr << "worker " << id << " failed, stopping the experiment" << std::endl;
+                stop_workers(pids);
+                exit(1);
+            }
+        }
+        if (shared.batches() >= checkpoint) {
+            std::cout << subfigure << "-" << "CO3: Completed " << shared.batches() << " batches @ " << BATCH_SIZE
+            << " over " << workers << " workers" << std::endl;
+            shared.snapshot(model.w.cube.data());
+            model.save(subfigure);
+            checkpoint = shared.batches() + CHECKPOINT_INTERVAL;
+        }
+    }
+    shared.snapshot(model.w.cube.data());
+
     auto stop = std::chrono::steady_clock::now();
     std::clog <<
     std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "," << model.sigma << ","
@@ -162,7 +338,7 @@ void figure(const Model<T>& model){
 void test_batch(){
     std::cout << "Testing batch" << std::endl;
     Model<double> model(1.0, 0.5, GRID_SIZE, RESOLUTION);
-    model.w = get_batch<double>(16);
+    model.w = CubeArray<double, Model<double>::Storage>(get_batch(16));
     std::cout << "Plotting batch" << std::endl;
     plt::Plot plot("test_plot");
     figure(model);
@@ -205,8 +381,62 @@ int main(int argc, char* argv[]) {
         LOWER_RES = std::floor(RESOLUTION/2);
         UPPER_RES = RESOLUTION - LOWER_RES;
     }
+    if (argc > 8) {
+        // 0 = exact, 1 = precise, 2 = fast
+        int exp_mode = std::stoi(argv[8]);
+        if (exp_mode < 0 || exp_mode > (int) ExpMode::FAST) {
+            std::cerr << "exp_mode must be between 0 and " << (int) ExpMode::FAST << std::endl;
+            exit(1);
+        }
+        EXP_MODE = static_cast<ExpMode>(exp_mode);
+    }
+    if (argc > 9) {
+        EXP_CUTOFF = std::stod(argv[9]);
+    }
+
+    if (argc > 10) {
+        WORKERS = std::stoi(argv[10]);
+    }
+    if (argc > 11) {
+        SYNC_INTERVAL = std::stoi(argv[11]);
+    }
+
+    if (argc > 12) {
+        PRUNE_THRESHOLD = std::stod(argv[12]);
+    }
+    if (argc > 13) {
+        RESPAWN = std::stoi(argv[13]) != 0;
+    }
+    if (argc > 14) {
+        COARSE_RES = std::stoi(argv[14]);
+    }
+    if (argc > 15) {
+        // '-' starts from random filters
+        WARM_START = argv[15][0] == '-' ? 0 : argv[15][0];
+    }
+    if (argc > 16) {
+        DATA_PATH = argv[16];
+    }
+
+    data = get_data(DATA_PATH);
+    if (data.nrows < (size_t) RESOLUTION || data.ncols < (size_t) RESOLUTION) {
+        std::cerr << "images are " << data.nrows << "x" << data.ncols << ", too small for resolution " << RESOLUTION << std::endl;
+        exit(1);
+    }
 
-    experiment<double>('a', sigma, lambda, nbatches);
+    if (WORKERS > 1 && COARSE_RES > 0 && COARSE_RES < RESOLUTION) {
+        std::cerr << "coarse_res is only supported with a single worker" << std::endl;
+        exit(1);
+    }
+    if (WORKERS > 1 && (PRUNE_THRESHOLD > 0 || RESPAWN)) {
+        std::cerr << "prune_threshold and respawn are only supported with a single worker" << std::endl;
+        exit(1);
+    }
+    if (WORKERS > 1) {
+        shared_experiment<double>('a', sigma, lambda, nbatches, WORKERS, SYNC_INTERVAL, WARM_START);
+    } else {
+        experiment<double>('a', sigma, lambda, nbatches, EXP_MODE, EXP_CUTOFF, PRUNE_THRESHOLD, RESPAWN, COARSE_RES, WARM_START);
+    }
     save_all<double>({'a'});
 
     Py_Finalize();